@@ -0,0 +1,171 @@
+/* Copyright (c) 2021, Kirill GPRB
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+/* Throughput and latency of feeding the parser through a vterm_ring.
+ * A synthetic producer thread generates colored text in PTY-sized
+ * chunks and pushes it into the ring while the main thread drains it.
+ * Latency is the time from a chunk being pushed to its last byte
+ * being parsed.
+ *
+ * Build: cc -O2 -I. bench/ring_bench.c libvterm.c libvterm_ring.c -o ring_bench -lpthread
+ * Usage: ring_bench [megabytes] [ring size] [chunk size] */
+#define _POSIX_C_SOURCE 200112L
+#include <libvterm_ring.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct bench {
+    struct vterm_ring ring;
+    unsigned char *data;
+    size_t total, chunk, nchunks;
+    double *pushed;
+    size_t stalls;
+};
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* bench_fill(s, n)                                     */
+/* generate terminal output that resembles a build log  */
+static void bench_fill(unsigned char *s, size_t n)
+{
+    static const char *const words[] = { "compiling", "src/vterm.c", "warning:", "ok", "\x1b[1;32m", "\x1b[0m", "\x1b[31m", "[100%]", "\r\n" };
+    size_t i = 0, k;
+    unsigned long seed = 1;
+    while(i < n) {
+        seed = seed * 1103515245UL + 12345UL;
+        k = strlen(words[(seed >> 16) % 9]);
+        if(k > n - i)
+            k = n - i;
+        memcpy(s + i, words[(seed >> 16) % 9], k);
+        i += k;
+        if(i < n)
+            s[i++] = ' ';
+    }
+}
+
+/* bench_producer(arg)                                  */
+/* push chunks as fast as the ring accepts them         */
+static void *bench_producer(void *arg)
+{
+    struct bench *b = arg;
+    size_t c, n, done;
+    for(c = 0; c < b->nchunks; c++) {
+        n = b->chunk;
+        if(n > b->total - c * b->chunk)
+            n = b->total - c * b->chunk;
+        b->pushed[c] = bench_now();
+        for(done = 0; done < n;) {
+            done += vterm_ring_push(&b->ring, b->data + c * b->chunk + done, n - done);
+            if(done < n) {
+                /* Back-pressure: the ring is full */
+                b->stalls++;
+                sched_yield();
+            }
+        }
+    }
+    return NULL;
+}
+
+static void *bench_alloc(size_t n)
+{
+    return malloc(n);
+}
+
+int main(int argc, char **argv)
+{
+    struct vterm vt;
+    struct vterm_callbacks callbacks;
+    struct bench b;
+    pthread_t thread;
+    size_t ring_size, consumed = 0, c = 0, n, end;
+    double start, elapsed, *latency;
+
+    memset(&b, 0, sizeof(b));
+    b.total = (size_t)(argc > 1 ? atof(argv[1]) : 64.0) * 1048576;
+    ring_size = argc > 2 ? (size_t)atol(argv[2]) : 65536;
+    b.chunk = argc > 3 ? (size_t)atol(argv[3]) : 4096;
+    b.nchunks = (b.total + b.chunk - 1) / b.chunk;
+    b.data = malloc(b.total);
+    b.pushed = malloc(b.nchunks * sizeof(double));
+    latency = malloc(b.nchunks * sizeof(double));
+    bench_fill(b.data, b.total);
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.mem_alloc = &bench_alloc;
+    callbacks.mem_free = &free;
+    vterm_init(&vt, &callbacks, NULL);
+    if(!vterm_ring_init(&b.ring, &vt, ring_size))
+        return 1;
+
+    start = bench_now();
+    pthread_create(&thread, NULL, &bench_producer, &b);
+    while(consumed < b.total) {
+        n = vterm_ring_drain(&b.ring, 0);
+        if(!n) {
+            sched_yield();
+            continue;
+        }
+
+        /* A chunk's latency ends when its last byte is parsed */
+        consumed += n;
+        for(; c < b.nchunks; c++) {
+            end = (c + 1) * b.chunk;
+            if(end > b.total)
+                end = b.total;
+            if(end > consumed)
+                break;
+            latency[c] = bench_now() - b.pushed[c];
+        }
+    }
+    elapsed = bench_now() - start;
+    pthread_join(thread, NULL);
+
+    qsort(latency, c, sizeof(double), &bench_cmp);
+    printf("%lu MiB through a %lu byte ring in %lu byte chunks\n", (unsigned long)(b.total >> 20), (unsigned long)b.ring.size, (unsigned long)b.chunk);
+    printf("throughput: %.1f MiB/s\n", b.total / elapsed / 1048576.0);
+    printf("latency:    p50 %.1f us, p99 %.1f us, max %.1f us\n", latency[c / 2] * 1e6, latency[c * 99 / 100] * 1e6, latency[c - 1] * 1e6);
+    printf("producer stalls (ring full): %lu\n", (unsigned long)b.stalls);
+
+    vterm_ring_shutdown(&b.ring);
+    vterm_shutdown(&vt);
+    free(latency);
+    free(b.pushed);
+    free(b.data);
+    return 0;
+}
@@ -0,0 +1,172 @@
+/* Copyright (c) 2021, Kirill GPRB
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+/* Cost per character of width lookups and of printing text through
+ * vterm_write for ASCII, CJK-heavy and emoji/combining corpora.
+ *
+ * Build: cc -O2 -I. bench/wcwidth_bench.c libvterm.c -o wcwidth_bench
+ * Usage: wcwidth_bench [characters] */
+#define _POSIX_C_SOURCE 200112L
+#include <libvterm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct corpus {
+    const char *name;
+    int (*gen)(unsigned long seed);
+};
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Plain ASCII text with a line break now and then */
+static int gen_ascii(unsigned long seed)
+{
+    if(seed % 72 == 71)
+        return '\n';
+    return 'a' + (int)(seed % 26);
+}
+
+/* Mostly CJK ideographs, some kana, hangul, fullwidth
+ * punctuation and ASCII, like chat logs or source comments */
+static int gen_cjk(unsigned long seed)
+{
+    switch(seed % 16) {
+        case 0:
+            return (seed % 5) ? 0x3001 + (int)(seed % 2) : '\n';
+        case 1:
+        case 2:
+            return 0x3041 + (int)(seed % 86);
+        case 3:
+            return 0xAC00 + (int)(seed % 11172);
+        case 4:
+            return 'a' + (int)(seed % 26);
+        default:
+            return 0x4E00 + (int)(seed % 20902);
+    }
+}
+
+/* Emoji, accented latin with combining marks and symbols */
+static int gen_emoji(unsigned long seed)
+{
+    switch(seed % 8) {
+        case 0:
+            return 0x1F600 + (int)(seed % 80);
+        case 1:
+            return 0x0300 + (int)(seed % 0x70);
+        case 2:
+            return 0x2600 + (int)(seed % 256);
+        case 3:
+            return (seed % 9) ? ' ' : '\n';
+        default:
+            return 'a' + (int)(seed % 26);
+    }
+}
+
+static size_t bench_utf8(int chr, unsigned char *s)
+{
+    if(chr < 0x80) {
+        s[0] = (unsigned char)chr;
+        return 1;
+    }
+    if(chr < 0x800) {
+        s[0] = (unsigned char)(0xC0 | (chr >> 6));
+        s[1] = (unsigned char)(0x80 | (chr & 0x3F));
+        return 2;
+    }
+    if(chr < 0x10000) {
+        s[0] = (unsigned char)(0xE0 | (chr >> 12));
+        s[1] = (unsigned char)(0x80 | ((chr >> 6) & 0x3F));
+        s[2] = (unsigned char)(0x80 | (chr & 0x3F));
+        return 3;
+    }
+    s[0] = (unsigned char)(0xF0 | (chr >> 18));
+    s[1] = (unsigned char)(0x80 | ((chr >> 12) & 0x3F));
+    s[2] = (unsigned char)(0x80 | ((chr >> 6) & 0x3F));
+    s[3] = (unsigned char)(0x80 | (chr & 0x3F));
+    return 4;
+}
+
+static void *bench_alloc(size_t n)
+{
+    return malloc(n);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct corpus corpora[] = {
+        { "ascii", &gen_ascii },
+        { "cjk", &gen_cjk },
+        { "emoji", &gen_emoji },
+    };
+    struct vterm vt;
+    struct vterm_callbacks callbacks;
+    size_t count, i, c, len;
+    unsigned long seed;
+    unsigned char *text;
+    int *chars;
+    volatile int sink = 0;
+    double start, lookup, write;
+
+    count = argc > 1 ? (size_t)atol(argv[1]) : 4000000;
+    chars = malloc(count * sizeof(int));
+    text = malloc(count * 4);
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.mem_alloc = &bench_alloc;
+    callbacks.mem_free = &free;
+
+    printf("%-6s %12s %14s %14s\n", "corpus", "bytes", "wcwidth ns/ch", "write ns/ch");
+    for(c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+        seed = 1;
+        for(i = 0, len = 0; i < count; i++) {
+            seed = seed * 1103515245UL + 12345UL;
+            chars[i] = corpora[c].gen((seed >> 8) & 0xFFFFFF);
+            len += bench_utf8(chars[i], text + len);
+        }
+
+        start = bench_now();
+        for(i = 0; i < count; i++)
+            sink += vterm_wcwidth(chars[i]);
+        lookup = bench_now() - start;
+
+        vterm_init(&vt, &callbacks, NULL);
+        start = bench_now();
+        vterm_write(&vt, text, len);
+        write = bench_now() - start;
+        vterm_shutdown(&vt);
+
+        printf("%-6s %12lu %14.2f %14.2f\n", corpora[c].name, (unsigned long)len, lookup * 1e9 / count, write * 1e9 / count);
+    }
+
+    free(text);
+    free(chars);
+    return sink < 0;
+}
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+# Generates libvterm_wcwidth.h - a two-level character width lookup table
+# built from the Unicode database shipped with the Python interpreter.
+# Usage: python3 gen_wcwidth.py > libvterm_wcwidth.h
+import sys
+import unicodedata
+
+BLOCK_BITS = 8
+BLOCK_SIZE = 1 << BLOCK_BITS
+MAX_CHR = 0x110000
+
+# Unassigned code points in these ranges are reserved for CJK ideographs
+# and are expected to be rendered as wide characters once assigned.
+WIDE_RANGES = [
+    (0x3400, 0x4DBF),
+    (0x4E00, 0x9FFF),
+    (0xF900, 0xFAFF),
+    (0x20000, 0x2FFFD),
+    (0x30000, 0x3FFFD),
+]
+
+def width(cp):
+    ch = chr(cp)
+    cat = unicodedata.category(ch)
+    if cp == 0x00AD:
+        return 1
+    if cat in ('Mn', 'Me', 'Cf') or cp == 0x200B:
+        return 0
+    if 0x1160 <= cp <= 0x11FF or 0xD7B0 <= cp <= 0xD7FF:
+        return 0
+    if unicodedata.east_asian_width(ch) in ('W', 'F'):
+        return 2
+    for beg, end in WIDE_RANGES:
+        if beg <= cp <= end:
+            return 2
+    return 1
+
+def main():
+    blocks = []
+    block_index = {}
+    stage1 = []
+    for base in range(0, MAX_CHR, BLOCK_SIZE):
+        packed = bytearray(BLOCK_SIZE // 4)
+        for i in range(BLOCK_SIZE):
+            cp = base + i
+            packed[i >> 2] |= width(cp) << ((i & 3) << 1)
+        packed = bytes(packed)
+        if packed not in block_index:
+            block_index[packed] = len(blocks)
+            blocks.append(packed)
+        stage1.append(block_index[packed])
+
+    if len(blocks) > 256:
+        sys.exit('gen_wcwidth.py: too many unique blocks')
+
+    out = sys.stdout
+    out.write('/* Generated by gen_wcwidth.py from Unicode %s - do not edit. */\n' % unicodedata.unidata_version)
+    out.write('#ifndef _LIBVTERM_WCWIDTH_H_\n')
+    out.write('#define _LIBVTERM_WCWIDTH_H_ 1\n\n')
+    out.write('#define VTERM_WCWIDTH_SHIFT (%d)\n' % BLOCK_BITS)
+    out.write('#define VTERM_WCWIDTH_MAX   (0x%X)\n\n' % MAX_CHR)
+    out.write('/* stage 1: code point >> %d to block number */\n' % BLOCK_BITS)
+    out.write('static const unsigned char vterm_wcwidth_stage1[%d] = {\n' % len(stage1))
+    for i in range(0, len(stage1), 16):
+        out.write('    ' + ', '.join('%d' % v for v in stage1[i:i + 16]) + ',\n')
+    out.write('};\n\n')
+    out.write('/* stage 2: four 2-bit widths per byte, lowest bits first */\n')
+    out.write('static const unsigned char vterm_wcwidth_stage2[%d][%d] = {\n' % (len(blocks), BLOCK_SIZE // 4))
+    for block in blocks:
+        out.write('    {\n')
+        for i in range(0, len(block), 16):
+            out.write('        ' + ', '.join('0x%02X' % v for v in block[i:i + 16]) + ',\n')
+        out.write('    },\n')
+    out.write('};\n\n')
+    out.write('#endif\n')
+
+if __name__ == '__main__':
+    main()
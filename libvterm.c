@@ -21,12 +21,31 @@
  * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
  * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
-#include <ctype.h>
 #include <libvterm.h>
+#include <libvterm_wcwidth.h>
 #include <string.h>
 
 static struct vterm_attrib default_attrib = { 0, VTERM_COLOR_BLK, VTERM_COLOR_WHT };
 
+/* Saved terminal state: the header is followed by runs of
+ * identical cells in the screen order and the tab stops. */
+struct vterm_state {
+    struct vterm_attrib current_attrib;
+    struct vterm_cursor cursor;
+    struct vterm_mode mode;
+    struct vterm_parser parser;
+    struct vterm_cursor curstack[VTERM_MAX_CURS];
+    unsigned int curstack_sp;
+    unsigned int tab_width;
+    int last_chr;
+    size_t runs;
+};
+
+struct vterm_state_run {
+    unsigned int count;
+    struct vterm_cell cell;
+};
+
 /* vterm_utodec(v)                                      */
 /* convert an unsigned integer to a decimal string      */
 static const char *vterm_utodec(unsigned int v)
@@ -66,21 +85,100 @@ static void vterm_response(struct vterm *vt, const unsigned int *v, size_t n, in
     }
 }
 
+/* vterm_touch(vt, y0, y1)                              */
+/* mark rows y0 to y1 as modified for the text caches   */
+static void vterm_touch(struct vterm *vt, unsigned int y0, unsigned int y1)
+{
+    /* Every row gets a serial of its own so that a serial
+     * identifies the row contents wherever they move to */
+    while(y0 <= y1 && y0 < vt->mode.scr_h)
+        vt->row_serial[y0++] = ++vt->serial;
+}
+
+/* vterm_damage(vt, i, n)                               */
+/* report n modified cells of a row starting at cell i  */
+static void vterm_damage(struct vterm *vt, unsigned int i, unsigned int n)
+{
+    unsigned int y = i / vt->mode.scr_w;
+    if(vt->callbacks.damage) {
+        vt->callbacks.damage(vt, i % vt->mode.scr_w, y, n);
+        return;
+    }
+
+    if(vt->callbacks.draw_cell) {
+        for(; n; n--, i++)
+            vt->callbacks.draw_cell(vt, vt->buffer[i].chr, i % vt->mode.scr_w, y, &vt->buffer[i].attrib);
+    }
+}
+
+/* vterm_fill(vt, i, n, cell)                           */
+/* fill n cells starting at cell i with the same value  */
+static void vterm_fill(struct vterm *vt, unsigned int i, unsigned int n, const struct vterm_cell *cell)
+{
+    unsigned int k, span;
+    for(k = 0; k < n; k++)
+        vt->buffer[i + k] = *cell;
+
+    /* One damage report for each row the span covers */
+    while(n) {
+        span = vt->mode.scr_w - (i % vt->mode.scr_w);
+        if(span > n)
+            span = n;
+        vterm_damage(vt, i, span);
+        i += span;
+        n -= span;
+    }
+}
+
+/* vterm_blank(vt, i)                                   */
+/* reset a single cell to the default attributes        */
+static void vterm_blank(struct vterm *vt, unsigned int i)
+{
+    struct vterm_cell *cell = vt->buffer + i;
+    cell->attrib = default_attrib;
+    cell->flags = 0;
+    cell->chr = VTERM_CHR_NUL;
+    memset(cell->comb, 0, sizeof(cell->comb));
+    vterm_damage(vt, i, 1);
+}
+
+/* vterm_unwide(vt, i)                                  */
+/* erase the other half of a wide character at cell i   */
+static void vterm_unwide(struct vterm *vt, unsigned int i)
+{
+    unsigned int flags = vt->buffer[i].flags;
+    if((flags & VTERM_CELL_WCONT) && (i % vt->mode.scr_w))
+        vterm_blank(vt, i - 1);
+    if((flags & VTERM_CELL_WIDE) && ((i + 1) % vt->mode.scr_w))
+        vterm_blank(vt, i + 1);
+}
+
 /* vterm_clear(vt, x0, y0, x1, y1)                      */
 /* clear a part of the screen or the whole screen       */
 static void vterm_clear(struct vterm *vt, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
 {
-    unsigned int i, beg, end;
-    struct vterm_cell *cell;
+    unsigned int beg, end, size;
+    struct vterm_cell blank;
+    size = vt->mode.scr_w * vt->mode.scr_h;
     beg = x0 + (y0 * vt->mode.scr_w);
-    end = x1 + (y1 * vt->mode.scr_h);
-    for(i = beg; i < end; i++) {
-        cell = vt->buffer + i;
-        cell->attrib = default_attrib;
-        cell->chr = VTERM_CHR_NUL;
-        if(vt->callbacks.draw_cell)
-            vt->callbacks.draw_cell(vt, cell->chr, i % vt->mode.scr_w, i / vt->mode.scr_w, &cell->attrib);
-    }
+    end = x1 + (y1 * vt->mode.scr_w);
+    if(end > size)
+        end = size;
+    if(beg >= end)
+        return;
+
+    /* Never leave half of a wide character behind */
+    if((beg % vt->mode.scr_w) && (vt->buffer[beg].flags & VTERM_CELL_WCONT))
+        beg--;
+    if(end < size && (vt->buffer[end - 1].flags & VTERM_CELL_WIDE))
+        end++;
+
+    blank.attrib = default_attrib;
+    blank.flags = 0;
+    blank.chr = VTERM_CHR_NUL;
+    memset(blank.comb, 0, sizeof(blank.comb));
+    vterm_fill(vt, beg, end - beg, &blank);
+    vterm_touch(vt, beg / vt->mode.scr_w, (end - 1) / vt->mode.scr_w);
 }
 
 /* vterm_setmode(vt)                                    */
@@ -88,7 +186,12 @@ static void vterm_clear(struct vterm *vt, unsigned int x0, unsigned int y0, unsi
 static void vterm_setmode(struct vterm *vt)
 {
     vt->callbacks.mem_free(vt->buffer);
-    vt->buffer = vt->callbacks.mem_alloc(vt->mode.scr_w * vt->mode.scr_h);
+    vt->callbacks.mem_free(vt->row_serial);
+    vt->callbacks.mem_free(vt->tabstops);
+    vt->buffer = vt->callbacks.mem_alloc(vt->mode.scr_w * vt->mode.scr_h * sizeof(struct vterm_cell));
+    vt->row_serial = vt->callbacks.mem_alloc(vt->mode.scr_h * sizeof(unsigned long));
+    vt->tabstops = vt->callbacks.mem_alloc(vt->mode.scr_w);
+    vterm_set_tab_width(vt, vt->tab_width);
     vt->cursor.x = vt->cursor.y = 0;
     if(vt->callbacks.set_cursor)
         vt->callbacks.set_cursor(vt, &vt->cursor);
@@ -100,27 +203,28 @@ static void vterm_setmode(struct vterm *vt)
 static void vterm_scroll(struct vterm *vt, unsigned int nl)
 {
     unsigned int i, line, end;
-    struct vterm_cell *cell;
+    struct vterm_cell blank;
 
     if(nl > vt->mode.scr_h)
         nl = vt->mode.scr_h;
     line = vt->mode.scr_h - nl;
     end = vt->mode.scr_w * line;
 
-    for(i = 0; i < end; i++) {
-        cell = vt->buffer + i;
-        memcpy(cell, cell + vt->mode.scr_w, sizeof(struct vterm_cell));
-        if(vt->callbacks.draw_cell)
-            vt->callbacks.draw_cell(vt, cell->chr, i % vt->mode.scr_w, i / vt->mode.scr_w, &cell->attrib);
-    }
+    memmove(vt->buffer, vt->buffer + nl * vt->mode.scr_w, end * sizeof(struct vterm_cell));
+    for(i = 0; i < end; i += vt->mode.scr_w)
+        vterm_damage(vt, i, vt->mode.scr_w);
 
-    for(i = 0; i < vt->mode.scr_w; i++) {
-        cell = vt->buffer + i + end;
-        cell->attrib = default_attrib;
-        cell->chr = VTERM_CHR_NUL;
-        if(vt->callbacks.draw_cell)
-            vt->callbacks.draw_cell(vt, cell->chr, i % vt->mode.scr_w, line, &cell->attrib);
-    }
+    blank.attrib = default_attrib;
+    blank.flags = 0;
+    blank.chr = VTERM_CHR_NUL;
+    memset(blank.comb, 0, sizeof(blank.comb));
+    vterm_fill(vt, end, nl * vt->mode.scr_w, &blank);
+
+    /* The rows keep their serials as they move up so the
+     * text caches only have to rebuild the new rows */
+    memmove(vt->row_serial, vt->row_serial + nl, line * sizeof(unsigned long));
+    vterm_touch(vt, line, vt->mode.scr_h - 1);
+    vt->scrolled += nl;
 
     vt->cursor.y -= (vt->cursor.y >= nl) ? nl : vt->cursor.y;
     if(vt->callbacks.set_cursor)
@@ -151,11 +255,41 @@ set_cursor:
         vt->callbacks.set_cursor(vt, &vt->cursor);
 }
 
+/* vterm_combine(vt, chr)                               */
+/* attach a zero-width character to the previous cell   */
+static void vterm_combine(struct vterm *vt, int chr)
+{
+    unsigned int i, k, x;
+    struct vterm_cell *cell;
+
+    x = vt->cursor.x;
+    if(x > vt->mode.scr_w)
+        x = vt->mode.scr_w;
+    if(!x)
+        return;
+
+    i = (x - 1) + (vt->cursor.y * vt->mode.scr_w);
+    if((vt->buffer[i].flags & VTERM_CELL_WCONT) && x >= 2)
+        i--;
+
+    /* Marks past the last slot are dropped */
+    cell = vt->buffer + i;
+    for(k = 0; k < VTERM_MAX_COMB && cell->comb[k]; k++)
+        ;
+    if(!cell->chr || k == VTERM_MAX_COMB)
+        return;
+
+    cell->comb[k] = chr;
+    vterm_touch(vt, vt->cursor.y, vt->cursor.y);
+    if(vt->callbacks.draw_cell)
+        vt->callbacks.draw_cell(vt, cell->chr, i % vt->mode.scr_w, vt->cursor.y, &cell->attrib);
+}
+
 /* vterm_print(vt, chr)                                 */
 /* handle ascii cursor movement and text data           */
 static void vterm_print(struct vterm *vt, int chr)
 {
-    unsigned int i, tab;
+    unsigned int i, width;
     struct vterm_cell *cell;
     switch(chr) {
         case VTERM_CHR_BEL:
@@ -171,9 +305,14 @@ static void vterm_print(struct vterm *vt, int chr)
             }
             break;
         case VTERM_CHR_HT:
-            tab = 4 - (vt->cursor.x % 4);
-            for(i = 0; i < tab; i++)
-                vterm_print(vt, ' ');
+            /* Jump to the next tab stop or to the last column */
+            if(vt->cursor.x + 1 < vt->mode.scr_w) {
+                for(i = vt->cursor.x + 1; i < vt->mode.scr_w - 1 && !vt->tabstops[i]; i++)
+                    ;
+                vt->cursor.x = i;
+                if(vt->callbacks.set_cursor)
+                    vt->callbacks.set_cursor(vt, &vt->cursor);
+            }
             break;
         case VTERM_CHR_LF:
             vterm_newline(vt, 1);
@@ -193,15 +332,46 @@ static void vterm_print(struct vterm *vt, int chr)
                 vt->callbacks.set_cursor(vt, &vt->cursor);
             break;
         default:
-            if(vt->cursor.x >= vt->mode.scr_w)
+            /* Combining marks don't occupy a cell of their own */
+            width = vterm_wcwidth(chr);
+            if(!width) {
+                vterm_combine(vt, chr);
+                break;
+            }
+            if(width > vt->mode.scr_w)
+                width = 1;
+
+            if(vt->cursor.x + width > vt->mode.scr_w)
                 vterm_newline(vt, 1);
-            cell = vt->buffer + vt->cursor.x + (vt->cursor.y * vt->mode.scr_w);
+
+            i = vt->cursor.x + (vt->cursor.y * vt->mode.scr_w);
+            vterm_unwide(vt, i);
+            if(width > 1)
+                vterm_unwide(vt, i + 1);
+
+            cell = vt->buffer + i;
             cell->attrib = vt->current_attrib;
+            cell->flags = (width > 1) ? VTERM_CELL_WIDE : 0;
             cell->chr = chr;
+            memset(cell->comb, 0, sizeof(cell->comb));
             if(vt->callbacks.set_cursor)
                 vt->callbacks.set_cursor(vt, &vt->cursor);
             if(vt->callbacks.draw_cell)
-                vt->callbacks.draw_cell(vt, cell->chr, vt->cursor.x++, vt->cursor.y, &cell->attrib);
+                vt->callbacks.draw_cell(vt, cell->chr, vt->cursor.x, vt->cursor.y, &cell->attrib);
+
+            if(width > 1) {
+                cell++;
+                cell->attrib = vt->current_attrib;
+                cell->flags = VTERM_CELL_WCONT;
+                cell->chr = VTERM_CHR_NUL;
+                memset(cell->comb, 0, sizeof(cell->comb));
+                if(vt->callbacks.draw_cell)
+                    vt->callbacks.draw_cell(vt, cell->chr, vt->cursor.x + 1, vt->cursor.y, &cell->attrib);
+            }
+
+            vterm_touch(vt, vt->cursor.y, vt->cursor.y);
+            vt->cursor.x += width;
+            vt->last_chr = chr;
             break;
     }
 }
@@ -289,6 +459,87 @@ static void vterm_csi_el(struct vterm *vt)
     }
 }
 
+/* vterm_csi_ech(vt)                                    */
+/* erase character - clear n cells from the cursor on   */
+static void vterm_csi_ech(struct vterm *vt)
+{
+    unsigned int arg = vt->parser.argv_val[0];
+    if(!vt->parser.argv_map[0] || !arg)
+        arg = 1;
+    if(vt->cursor.x >= vt->mode.scr_w)
+        return;
+    if(arg > vt->mode.scr_w - vt->cursor.x)
+        arg = vt->mode.scr_w - vt->cursor.x;
+    vterm_clear(vt, vt->cursor.x, vt->cursor.y, vt->cursor.x + arg, vt->cursor.y);
+}
+
+/* vterm_csi_rep(vt)                                    */
+/* repeat - print the last character n more times       */
+static void vterm_csi_rep(struct vterm *vt)
+{
+    unsigned int i, span, arg;
+    struct vterm_cell cell;
+
+    arg = vt->parser.argv_val[0];
+    if(!vt->parser.argv_map[0] || !arg)
+        arg = 1;
+    if(!vt->last_chr)
+        return;
+
+    /* Anything past a screenful only scrolls the same
+     * text through, don't let a bogus count hang us */
+    if(arg > vt->mode.scr_w * vt->mode.scr_h)
+        arg = vt->mode.scr_w * vt->mode.scr_h;
+
+    /* Wide characters need the whole wrapping logic */
+    if(vterm_wcwidth(vt->last_chr) != 1) {
+        while(arg--)
+            vterm_print(vt, vt->last_chr);
+        return;
+    }
+
+    cell.attrib = vt->current_attrib;
+    cell.flags = 0;
+    cell.chr = vt->last_chr;
+    memset(cell.comb, 0, sizeof(cell.comb));
+
+    while(arg) {
+        if(vt->cursor.x >= vt->mode.scr_w)
+            vterm_newline(vt, 1);
+        span = vt->mode.scr_w - vt->cursor.x;
+        if(span > arg)
+            span = arg;
+        i = vt->cursor.x + (vt->cursor.y * vt->mode.scr_w);
+        vterm_unwide(vt, i);
+        vterm_unwide(vt, i + span - 1);
+        vterm_fill(vt, i, span, &cell);
+        vterm_touch(vt, vt->cursor.y, vt->cursor.y);
+        vt->cursor.x += span;
+        arg -= span;
+    }
+
+    if(vt->callbacks.set_cursor)
+        vt->callbacks.set_cursor(vt, &vt->cursor);
+}
+
+/* vterm_csi_tbc(vt)                                    */
+/* tabulation clear - remove one or all tab stops       */
+static void vterm_csi_tbc(struct vterm *vt)
+{
+    unsigned int arg = vt->parser.argv_val[0];
+    if(!vt->parser.argv_map[0])
+        arg = 0;
+    switch(arg) {
+        case 0:
+            if(vt->cursor.x < vt->mode.scr_w)
+                vt->tabstops[vt->cursor.x] = 0;
+            break;
+        case 3:
+            memset(vt->tabstops, 0, vt->mode.scr_w);
+            break;
+    }
+}
+
 /* vterm_csi_sgr(vt)                                    */
 /* select graphic rendition - color/style of the text   */
 static void vterm_csi_sgr(struct vterm *vt)
@@ -479,6 +730,15 @@ static void vterm_putchar(struct vterm *vt, int chr)
     }
 
     if(vt->parser.state == VTERM_STATE_BRACKET) {
+        if(chr == 'H') {
+            /* HTS - set a tab stop at the cursor */
+            if(vt->cursor.x < vt->mode.scr_w)
+                vt->tabstops[vt->cursor.x] = 1;
+            vt->parser.prefix_chr = 0;
+            vt->parser.state = VTERM_STATE_ESCAPE;
+            goto done;
+        }
+
         if(chr != VTERM_CHR_CSI) {
             vt->parser.prefix_chr = 0;
             vt->parser.state = VTERM_STATE_ESCAPE;
@@ -496,7 +756,7 @@ static void vterm_putchar(struct vterm *vt, int chr)
             goto done;
         }
 
-        if(isdigit(chr)) {
+        if(chr >= '0' && chr <= '9') {
             vt->parser.argv_val[vt->parser.argp] *= 10;
             vt->parser.argv_val[vt->parser.argp] += (chr - '0');
             vt->parser.argv_map[vt->parser.argp] = 1;
@@ -551,6 +811,15 @@ done:
                     arg = 1;
                 vterm_scroll(vt, arg);
                 break;
+            case 'X':
+                vterm_csi_ech(vt);
+                break;
+            case 'b':
+                vterm_csi_rep(vt);
+                break;
+            case 'g':
+                vterm_csi_tbc(vt);
+                break;
             case 'm':
                 vterm_csi_sgr(vt);
                 break;
@@ -572,6 +841,59 @@ done:
     }
 }
 
+/* vterm_putbyte(vt, chr)                               */
+/* decode UTF-8 and pass the characters to the parser   */
+static void vterm_putbyte(struct vterm *vt, unsigned int chr)
+{
+    if(vt->parser.utf8_len) {
+        /* The bounds of the next continuation byte rule out
+         * overlong forms, surrogates and values past U+10FFFF */
+        if(chr >= vt->parser.utf8_lo && chr <= vt->parser.utf8_hi) {
+            vt->parser.utf8_chr = (vt->parser.utf8_chr << 6) | (chr & 0x3F);
+            vt->parser.utf8_lo = 0x80;
+            vt->parser.utf8_hi = 0xBF;
+            if(!--vt->parser.utf8_len)
+                vterm_putchar(vt, vt->parser.utf8_chr);
+            return;
+        }
+
+        /* Invalid or truncated sequence, the byte starts something new */
+        vt->parser.utf8_len = 0;
+        vterm_putchar(vt, VTERM_CHR_RPL);
+    }
+
+    vt->parser.utf8_lo = 0x80;
+    vt->parser.utf8_hi = 0xBF;
+
+    if(chr < 0x80) {
+        vterm_putchar(vt, chr);
+    }
+    else if(chr >= 0xC2 && chr <= 0xDF) {
+        vt->parser.utf8_chr = chr & 0x1F;
+        vt->parser.utf8_len = 1;
+    }
+    else if(chr >= 0xE0 && chr <= 0xEF) {
+        vt->parser.utf8_chr = chr & 0x0F;
+        vt->parser.utf8_len = 2;
+        if(chr == 0xE0)
+            vt->parser.utf8_lo = 0xA0;
+        if(chr == 0xED)
+            vt->parser.utf8_hi = 0x9F;
+    }
+    else if(chr >= 0xF0 && chr <= 0xF4) {
+        vt->parser.utf8_chr = chr & 0x07;
+        vt->parser.utf8_len = 3;
+        if(chr == 0xF0)
+            vt->parser.utf8_lo = 0x90;
+        if(chr == 0xF4)
+            vt->parser.utf8_hi = 0x8F;
+    }
+    else {
+        /* Stray continuation bytes and C0, C1, F5-FF leads */
+        vterm_putchar(vt, VTERM_CHR_RPL);
+    }
+}
+
 /* vterm_init(vt, callbacks, user)                      */
 /* initialize a libvterm instance with default values   */
 int vterm_init(struct vterm *vt, const struct vterm_callbacks *callbacks, void *user)
@@ -592,6 +914,10 @@ int vterm_init(struct vterm *vt, const struct vterm_callbacks *callbacks, void *
     vt->mode.flags |= VTERM_MODEF_SCROLL;
 
     vt->parser.argp = 0;
+    vt->parser.utf8_chr = 0;
+    vt->parser.utf8_len = 0;
+    vt->parser.utf8_lo = 0x80;
+    vt->parser.utf8_hi = 0xBF;
     vt->parser.prefix_chr = VTERM_CHR_NUL;
     vt->parser.state = VTERM_STATE_ESCAPE;
 
@@ -603,6 +929,9 @@ int vterm_init(struct vterm *vt, const struct vterm_callbacks *callbacks, void *
     memset(vt->parser.argv_map, 0, sizeof(vt->parser.argv_map));
     memset(vt->parser.argv_val, 0, sizeof(vt->parser.argv_val));
 
+    vt->tab_width = VTERM_TAB_WIDTH;
+    vt->last_chr = VTERM_CHR_NUL;
+
     vterm_setmode(vt);
 
     return 1;
@@ -613,15 +942,354 @@ int vterm_init(struct vterm *vt, const struct vterm_callbacks *callbacks, void *
 void vterm_shutdown(struct vterm *vt)
 {
     vt->callbacks.mem_free(vt->buffer);
+    vt->callbacks.mem_free(vt->row_serial);
+    vt->callbacks.mem_free(vt->tabstops);
     memset(vt, 0, sizeof(struct vterm));
 }
 
 /* vterm_write(vt, s, n)                                */
-/* call vterm_putchar for all the values in the buffer  */
+/* call vterm_putbyte for all the values in the buffer  */
 int vterm_write(struct vterm *vt, const void *s, size_t n)
 {
-    const char *sp = s;
+    const unsigned char *sp = s;
     while(n--)
-        vterm_putchar(vt, *sp++);
+        vterm_putbyte(vt, *sp++);
+    return 1;
+}
+
+/* vterm_set_tab_width(vt, width)                       */
+/* reset the tab stops to every width columns           */
+void vterm_set_tab_width(struct vterm *vt, unsigned int width)
+{
+    unsigned int x;
+    vt->tab_width = width;
+    for(x = 0; x < vt->mode.scr_w; x++)
+        vt->tabstops[x] = (width && x && !(x % width));
+}
+
+/* vterm_wcwidth(chr)                                   */
+/* number of cells a character occupies (0, 1 or 2)     */
+int vterm_wcwidth(int chr)
+{
+    unsigned int bits;
+    if(chr < 0x300 || chr >= VTERM_WCWIDTH_MAX)
+        return 1;
+    bits = vterm_wcwidth_stage2[vterm_wcwidth_stage1[chr >> VTERM_WCWIDTH_SHIFT]][(chr & ((1 << VTERM_WCWIDTH_SHIFT) - 1)) >> 2];
+    return (bits >> ((chr & 3) << 1)) & 3;
+}
+
+
+/* vterm_cellcmp(a, b)                                  */
+/* check whether two cells look exactly the same        */
+static int vterm_cellcmp(const struct vterm_cell *a, const struct vterm_cell *b)
+{
+    unsigned int k;
+    for(k = 0; k < VTERM_MAX_COMB; k++) {
+        if(a->comb[k] != b->comb[k])
+            return 0;
+    }
+    return a->chr == b->chr && a->flags == b->flags && a->attrib.attr == b->attrib.attr && a->attrib.bg == b->attrib.bg && a->attrib.fg == b->attrib.fg;
+}
+
+/* vterm_save_state(vt, s, n)                           */
+/* save the terminal state, returns the size it needs   */
+size_t vterm_save_state(const struct vterm *vt, void *s, size_t n)
+{
+    unsigned int i, size;
+    struct vterm_state state;
+    struct vterm_state_run run;
+    unsigned char *sp = s;
+    size_t len;
+
+    size = vt->mode.scr_w * vt->mode.scr_h;
+
+    state.current_attrib = vt->current_attrib;
+    state.cursor = vt->cursor;
+    state.mode = vt->mode;
+    state.parser = vt->parser;
+    memcpy(state.curstack, vt->curstack, sizeof(state.curstack));
+    state.curstack_sp = vt->curstack_sp;
+    state.tab_width = vt->tab_width;
+    state.last_chr = vt->last_chr;
+    state.runs = 0;
+    for(i = 0; i < size; i++) {
+        if(!i || !vterm_cellcmp(vt->buffer + i, vt->buffer + i - 1))
+            state.runs++;
+    }
+
+    len = sizeof(struct vterm_state) + state.runs * sizeof(struct vterm_state_run) + vt->mode.scr_w;
+    if(!sp || n < len)
+        return len;
+
+    memcpy(sp, &state, sizeof(struct vterm_state));
+    sp += sizeof(struct vterm_state);
+
+    /* Terminal screens are mostly made of blank space
+     * so a trivial run-length encoding goes a long way */
+    for(i = 0; i < size; i += run.count) {
+        run.cell = vt->buffer[i];
+        run.count = 1;
+        while(i + run.count < size && vterm_cellcmp(vt->buffer + i + run.count, &run.cell))
+            run.count++;
+        memcpy(sp, &run, sizeof(struct vterm_state_run));
+        sp += sizeof(struct vterm_state_run);
+    }
+
+    memcpy(sp, vt->tabstops, vt->mode.scr_w);
+    return len;
+}
+
+/* vterm_load_state(vt, s, n)                           */
+/* restore a state saved with vterm_save_state          */
+int vterm_load_state(struct vterm *vt, const void *s, size_t n)
+{
+    unsigned int i, size;
+    size_t r, count;
+    struct vterm_state state;
+    struct vterm_state_run run;
+    const unsigned char *sp = s;
+
+    if(n < sizeof(struct vterm_state))
+        return 0;
+    memcpy(&state, sp, sizeof(struct vterm_state));
+    sp += sizeof(struct vterm_state);
+
+    if(!state.mode.scr_w || !state.mode.scr_h || state.curstack_sp > VTERM_MAX_CURS)
+        return 0;
+    if(n != sizeof(struct vterm_state) + state.runs * sizeof(struct vterm_state_run) + state.mode.scr_w)
+        return 0;
+
+    size = state.mode.scr_w * state.mode.scr_h;
+    for(r = 0, count = 0; r < state.runs; r++) {
+        memcpy(&run, sp + r * sizeof(struct vterm_state_run), sizeof(struct vterm_state_run));
+        count += run.count;
+    }
+    if(count != size)
+        return 0;
+
+    if(state.mode.scr_w != vt->mode.scr_w || state.mode.scr_h != vt->mode.scr_h) {
+        vt->mode = state.mode;
+        vterm_setmode(vt);
+    }
+
+    for(r = 0, i = 0; r < state.runs; r++) {
+        memcpy(&run, sp + r * sizeof(struct vterm_state_run), sizeof(struct vterm_state_run));
+        while(run.count--)
+            vt->buffer[i++] = run.cell;
+    }
+    for(i = 0; i < size; i += vt->mode.scr_w)
+        vterm_damage(vt, i, vt->mode.scr_w);
+
+    vt->current_attrib = state.current_attrib;
+    vt->cursor = state.cursor;
+    vt->mode = state.mode;
+    vt->parser = state.parser;
+    memcpy(vt->curstack, state.curstack, sizeof(vt->curstack));
+    vt->curstack_sp = state.curstack_sp;
+    vt->tab_width = state.tab_width;
+    vt->last_chr = state.last_chr;
+    memcpy(vt->tabstops, sp + state.runs * sizeof(struct vterm_state_run), vt->mode.scr_w);
+
+    vterm_touch(vt, 0, vt->mode.scr_h - 1);
+    if(vt->callbacks.set_cursor)
+        vt->callbacks.set_cursor(vt, &vt->cursor);
+
     return 1;
 }
+
+/* vterm_utf8(chr, s)                                   */
+/* encode a character as UTF-8, returns the length      */
+static size_t vterm_utf8(int chr, char *s)
+{
+    if(chr < 0 || chr > 0x10FFFF)
+        chr = VTERM_CHR_RPL;
+    if(chr < 0x80) {
+        s[0] = (char)chr;
+        return 1;
+    }
+    if(chr < 0x800) {
+        s[0] = (char)(0xC0 | (chr >> 6));
+        s[1] = (char)(0x80 | (chr & 0x3F));
+        return 2;
+    }
+    if(chr < 0x10000) {
+        s[0] = (char)(0xE0 | (chr >> 12));
+        s[1] = (char)(0x80 | ((chr >> 6) & 0x3F));
+        s[2] = (char)(0x80 | (chr & 0x3F));
+        return 3;
+    }
+    s[0] = (char)(0xF0 | (chr >> 18));
+    s[1] = (char)(0x80 | ((chr >> 12) & 0x3F));
+    s[2] = (char)(0x80 | ((chr >> 6) & 0x3F));
+    s[3] = (char)(0x80 | (chr & 0x3F));
+    return 4;
+}
+
+/* vterm_row_text(vt, y, s, n)                          */
+/* row y as UTF-8 without trailing blanks, returns size */
+size_t vterm_row_text(const struct vterm *vt, unsigned int y, char *s, size_t n)
+{
+    char enc[4 * (1 + VTERM_MAX_COMB)];
+    unsigned int x, c;
+    size_t len = 0, trim = 0, k;
+    const struct vterm_cell *cell;
+
+    if(!n)
+        return 0;
+
+    if(y < vt->mode.scr_h) {
+        cell = vt->buffer + (y * vt->mode.scr_w);
+        for(x = 0; x < vt->mode.scr_w; x++, cell++) {
+            if(cell->flags & VTERM_CELL_WCONT)
+                continue;
+
+            /* A cell is emitted as a whole with its marks */
+            k = vterm_utf8(cell->chr ? cell->chr : ' ', enc);
+            for(c = 0; c < VTERM_MAX_COMB && cell->comb[c]; c++)
+                k += vterm_utf8(cell->comb[c], enc + k);
+            if(len + k >= n)
+                break;
+            memcpy(s + len, enc, k);
+            len += k;
+            if((cell->chr && cell->chr != ' ') || c)
+                trim = len;
+        }
+    }
+
+    s[trim] = VTERM_CHR_NUL;
+    return trim;
+}
+
+/* vterm_column(s, off)                                 */
+/* screen column of the byte offset off in a row text   */
+static unsigned int vterm_column(const char *s, size_t off)
+{
+    int chr;
+    size_t i = 0;
+    unsigned int x = 0;
+    const unsigned char *sp = (const unsigned char *)s;
+
+    while(i < off) {
+        chr = sp[i++];
+        if(chr >= 0xC0) {
+            chr &= (chr >= 0xF0) ? 0x07 : (chr >= 0xE0) ? 0x0F : 0x1F;
+            while(i < off && (sp[i] & 0xC0) == 0x80)
+                chr = (chr << 6) | (sp[i++] & 0x3F);
+        }
+        x += vterm_wcwidth(chr);
+    }
+
+    return x;
+}
+
+/* vterm_search_init(search, vt)                        */
+/* attach a row text cache to a libvterm instance       */
+int vterm_search_init(struct vterm_search *search, struct vterm *vt)
+{
+    memset(search, 0, sizeof(struct vterm_search));
+    search->vt = vt;
+    return 1;
+}
+
+/* vterm_search_shutdown(search)                        */
+/* free the row text cache                              */
+void vterm_search_shutdown(struct vterm_search *search)
+{
+    if(search->vt) {
+        search->vt->callbacks.mem_free(search->text);
+        search->vt->callbacks.mem_free(search->len);
+        search->vt->callbacks.mem_free(search->serial);
+        search->vt->callbacks.mem_free(search->changed);
+    }
+    memset(search, 0, sizeof(struct vterm_search));
+}
+
+/* vterm_search_update(search)                          */
+/* re-encode modified rows, returns how many were built */
+unsigned int vterm_search_update(struct vterm_search *search)
+{
+    unsigned int y, keep, count = 0;
+    unsigned long delta;
+    struct vterm *vt = search->vt;
+
+    /* The cache follows the video mode of the terminal */
+    if(search->scr_w != vt->mode.scr_w || search->scr_h != vt->mode.scr_h) {
+        vterm_search_shutdown(search);
+        search->vt = vt;
+        search->scr_w = vt->mode.scr_w;
+        search->scr_h = vt->mode.scr_h;
+        search->stride = VTERM_ROW_TEXT_MAX(search->scr_w);
+        search->text = vt->callbacks.mem_alloc(search->stride * search->scr_h);
+        search->len = vt->callbacks.mem_alloc(search->scr_h * sizeof(size_t));
+        search->serial = vt->callbacks.mem_alloc(search->scr_h * sizeof(unsigned long));
+        search->changed = vt->callbacks.mem_alloc(search->scr_h);
+        search->scrolled = vt->scrolled;
+        for(y = 0; y < search->scr_h; y++)
+            search->serial[y] = 0;
+    }
+
+    /* Move the cached rows along with the screen; the rows
+     * scrolled in have stale serials and get rebuilt below */
+    delta = vt->scrolled - search->scrolled;
+    search->scrolled = vt->scrolled;
+    if(delta && delta < search->scr_h) {
+        keep = search->scr_h - (unsigned int)delta;
+        memmove(search->text, search->text + delta * search->stride, keep * search->stride);
+        memmove(search->len, search->len + delta, keep * sizeof(size_t));
+        memmove(search->serial, search->serial + delta, keep * sizeof(unsigned long));
+    }
+
+    for(y = 0; y < search->scr_h; y++) {
+        search->changed[y] = (search->serial[y] != vt->row_serial[y]);
+        if(search->changed[y]) {
+            search->len[y] = vterm_row_text(vt, y, search->text + y * search->stride, search->stride);
+            search->serial[y] = vt->row_serial[y];
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/* vterm_search_row(search, y, len)                     */
+/* cached UTF-8 text of row y as of the last update     */
+const char *vterm_search_row(const struct vterm_search *search, unsigned int y, size_t *len)
+{
+    if(y >= search->scr_h)
+        return NULL;
+    if(len)
+        *len = search->len[y];
+    return search->text + y * search->stride;
+}
+
+/* vterm_search_find(search, needle, flags, pos)        */
+/* find needle in the cached rows starting at pos       */
+int vterm_search_find(const struct vterm_search *search, const char *needle, unsigned int flags, struct vterm_cursor *pos)
+{
+    unsigned int y, x;
+    const char *row, *match;
+
+    if(!needle[0])
+        return 0;
+
+    for(y = pos->y; y < search->scr_h; y++) {
+        if((flags & VTERM_SEARCH_CHANGED) && !search->changed[y])
+            continue;
+
+        row = search->text + y * search->stride;
+        match = strstr(row, needle);
+        while(match) {
+            x = vterm_column(row, (size_t)(match - row));
+            if(y > pos->y || x >= pos->x) {
+                pos->x = x;
+                pos->y = y;
+                return 1;
+            }
+            if(!*match)
+                break;
+            match = strstr(match + 1, needle);
+        }
+    }
+
+    return 0;
+}
@@ -36,6 +36,7 @@
 #define VTERM_CHR_DEL (0x7F) /* delete character */
 #define VTERM_CHR_ESC (0x1B) /* sequence start   */
 #define VTERM_CHR_CSI (0x5B) /* control sequence */
+#define VTERM_CHR_RPL (0xFFFD) /* replacement char */
 
 #define VTERM_ATTR_BOLD     (1 << 0)
 #define VTERM_ATTR_DIM      (1 << 1)
@@ -61,17 +62,27 @@
 #define VTERM_COLOR_WHT (7)
 #define VTERM_COLOR_DEF (9)
 
+#define VTERM_CELL_WIDE  (1 << 0) /* first half of a wide character */
+#define VTERM_CELL_WCONT (1 << 1) /* second half of a wide character */
+
 #define VTERM_MODEF_COLOR  (1 << 0)
 #define VTERM_MODEF_SCROLL (1 << 1)
 
 #define VTERM_MAX_ARGS (8)
 #define VTERM_MAX_CURS (8)
+#define VTERM_TAB_WIDTH (8)
+#define VTERM_MAX_COMB  (2)
+
+/* Buffer size that always fits the UTF-8 text of a row */
+#define VTERM_ROW_TEXT_MAX(scr_w) (4 * (1 + VTERM_MAX_COMB) * (size_t)(scr_w) + 1)
 
 #define VTERM_STATE_ESCAPE  (0)
 #define VTERM_STATE_BRACKET (1)
 #define VTERM_STATE_ATTRIB  (2)
 #define VTERM_STATE_ENDVAL  (3)
 
+#define VTERM_SEARCH_CHANGED (1 << 0) /* only rows rebuilt by the last update */
+
 struct vterm;
 
 struct vterm_attrib {
@@ -81,7 +92,9 @@ struct vterm_attrib {
 
 struct vterm_cell {
     struct vterm_attrib attrib;
+    unsigned int flags;
     int chr;
+    int comb[VTERM_MAX_COMB];
 };
 
 struct vterm_cursor {
@@ -104,10 +117,14 @@ struct vterm_callbacks {
     void (*draw_cell)(const struct vterm *vt, int chr, unsigned int x, unsigned int y, const struct vterm_attrib *attrib);
     void (*response)(const struct vterm *vt, int chr);
     void (*ascii)(const struct vterm *vt, int chr);
+    void (*damage)(const struct vterm *vt, unsigned int x, unsigned int y, unsigned int n);
 };
 
 struct vterm_parser {
     int prefix_chr;
+    int utf8_chr;
+    unsigned int utf8_len;
+    unsigned int utf8_lo, utf8_hi;
     unsigned int state, argp;
     unsigned int argv_val[VTERM_MAX_ARGS];
     unsigned int argv_map[VTERM_MAX_ARGS];
@@ -122,11 +139,43 @@ struct vterm {
     struct vterm_parser parser;
     struct vterm_cursor curstack[VTERM_MAX_CURS];
     unsigned int curstack_sp;
+    unsigned long *row_serial;
+    unsigned long serial;
+    unsigned long scrolled;
+    unsigned char *tabstops;
+    unsigned int tab_width;
+    int last_chr;
     void *user;
 };
 
+/* Per-row UTF-8 text cache over the screen of a terminal.
+ * Rows are only re-encoded when the terminal has touched
+ * them since the last call to vterm_search_update. */
+struct vterm_search {
+    struct vterm *vt;
+    char *text;
+    size_t *len;
+    unsigned long *serial;
+    unsigned char *changed;
+    unsigned long scrolled;
+    size_t stride;
+    unsigned int scr_w;
+    unsigned int scr_h;
+};
+
 int vterm_init(struct vterm *vt, const struct vterm_callbacks *callbacks, void *user);
 void vterm_shutdown(struct vterm *vt);
 int vterm_write(struct vterm *vt, const void *s, size_t n);
+int vterm_wcwidth(int chr);
+void vterm_set_tab_width(struct vterm *vt, unsigned int width);
+size_t vterm_row_text(const struct vterm *vt, unsigned int y, char *s, size_t n);
+size_t vterm_save_state(const struct vterm *vt, void *s, size_t n);
+int vterm_load_state(struct vterm *vt, const void *s, size_t n);
+
+int vterm_search_init(struct vterm_search *search, struct vterm *vt);
+void vterm_search_shutdown(struct vterm_search *search);
+unsigned int vterm_search_update(struct vterm_search *search);
+const char *vterm_search_row(const struct vterm_search *search, unsigned int y, size_t *len);
+int vterm_search_find(const struct vterm_search *search, const char *needle, unsigned int flags, struct vterm_cursor *pos);
 
 #endif
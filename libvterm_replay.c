@@ -0,0 +1,227 @@
+/* Copyright (c) 2021, Kirill GPRB
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+#include <libvterm_replay.h>
+#include <string.h>
+
+/* vterm_replay_u32(s)                                  */
+/* decode a little-endian 32-bit value                  */
+static unsigned long vterm_replay_u32(const unsigned char *s)
+{
+    return (unsigned long)s[0] | ((unsigned long)s[1] << 8) | ((unsigned long)s[2] << 16) | ((unsigned long)s[3] << 24);
+}
+
+/* vterm_replay_frame(rp, off, time, size)              */
+/* read a frame header, fails on an incomplete frame    */
+static int vterm_replay_frame(struct vterm_replay *rp, VTERM_REPLAY_OFF off, unsigned long *time, unsigned long *size)
+{
+    unsigned char hdr[VTERM_REPLAY_FRAME_HDR];
+    if(rp->reader.read(rp->reader.user, off, hdr, sizeof(hdr)) != sizeof(hdr))
+        return 0;
+    *time = vterm_replay_u32(hdr);
+    *size = vterm_replay_u32(hdr + 4);
+
+    /* The recording may still be growing: make sure
+     * the last byte of the payload is already there */
+    if(*size && rp->reader.read(rp->reader.user, off + sizeof(hdr) + *size - 1, rp->chunk, 1) != 1)
+        return 0;
+    return 1;
+}
+
+/* vterm_replay_feed(rp, vt, off, size)                 */
+/* stream a frame payload through the parser            */
+static int vterm_replay_feed(struct vterm_replay *rp, struct vterm *vt, VTERM_REPLAY_OFF off, unsigned long size)
+{
+    size_t n;
+    while(size) {
+        n = (size > VTERM_REPLAY_CHUNK) ? VTERM_REPLAY_CHUNK : (size_t)size;
+        if(rp->reader.read(rp->reader.user, off, rp->chunk, n) != n)
+            return 0;
+        vterm_write(vt, rp->chunk, n);
+        off += n;
+        size -= n;
+    }
+    return 1;
+}
+
+/* vterm_replay_keyframe(rp)                            */
+/* snapshot the scratch terminal at the scan position   */
+static int vterm_replay_keyframe(struct vterm_replay *rp)
+{
+    struct vterm_keyframe *key, *keys;
+    size_t max_keys;
+
+    if(rp->num_keys == rp->max_keys) {
+        max_keys = rp->max_keys ? rp->max_keys * 2 : 16;
+        keys = rp->vt->callbacks.mem_alloc(max_keys * sizeof(struct vterm_keyframe));
+        if(!keys)
+            return 0;
+        if(rp->keys)
+            memcpy(keys, rp->keys, rp->num_keys * sizeof(struct vterm_keyframe));
+        rp->vt->callbacks.mem_free(rp->keys);
+        rp->keys = keys;
+        rp->max_keys = max_keys;
+    }
+
+    key = rp->keys + rp->num_keys;
+    key->time = rp->scan_time;
+    key->off = rp->scan_off;
+    key->size = vterm_save_state(&rp->scratch, NULL, 0);
+    key->state = rp->vt->callbacks.mem_alloc(key->size);
+    if(!key->state)
+        return 0;
+    vterm_save_state(&rp->scratch, key->state, key->size);
+
+    rp->num_keys++;
+    rp->pending = 0;
+    return 1;
+}
+
+/* vterm_replay_init(rp, vt, reader, interval)          */
+/* set up a replay of a recording into a terminal       */
+int vterm_replay_init(struct vterm_replay *rp, struct vterm *vt, const struct vterm_replay_reader *reader, size_t interval)
+{
+    struct vterm_callbacks callbacks;
+
+    memset(rp, 0, sizeof(struct vterm_replay));
+    if(!reader->read)
+        return 0;
+
+    /* The index is built by a terminal of its own so
+     * that scanning doesn't draw anything on the screen */
+    memset(&callbacks, 0, sizeof(struct vterm_callbacks));
+    callbacks.mem_alloc = vt->callbacks.mem_alloc;
+    callbacks.mem_free = vt->callbacks.mem_free;
+    if(!vterm_init(&rp->scratch, &callbacks, NULL))
+        return 0;
+
+    rp->vt = vt;
+    rp->reader = *reader;
+    rp->interval = interval ? interval : VTERM_REPLAY_INTERVAL;
+
+    if(!vterm_replay_keyframe(rp)) {
+        vterm_replay_shutdown(rp);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* vterm_replay_shutdown(rp)                            */
+/* free the keyframes and the scratch terminal          */
+void vterm_replay_shutdown(struct vterm_replay *rp)
+{
+    size_t i;
+    if(rp->vt) {
+        for(i = 0; i < rp->num_keys; i++)
+            rp->vt->callbacks.mem_free(rp->keys[i].state);
+        rp->vt->callbacks.mem_free(rp->keys);
+        vterm_shutdown(&rp->scratch);
+    }
+    memset(rp, 0, sizeof(struct vterm_replay));
+}
+
+/* vterm_replay_rewind(rp)                              */
+/* rebuild the scratch terminal at the scan position    */
+static int vterm_replay_rewind(struct vterm_replay *rp)
+{
+    unsigned long time, size;
+    VTERM_REPLAY_OFF off;
+    const struct vterm_keyframe *key = rp->keys + rp->num_keys - 1;
+
+    if(!vterm_load_state(&rp->scratch, key->state, key->size))
+        return 0;
+
+    for(off = key->off; off < rp->scan_off; off += VTERM_REPLAY_FRAME_HDR + size) {
+        if(!vterm_replay_frame(rp, off, &time, &size))
+            return 0;
+        if(!vterm_replay_feed(rp, &rp->scratch, off + VTERM_REPLAY_FRAME_HDR, size))
+            return 0;
+    }
+
+    rp->stale = 0;
+    return 1;
+}
+
+/* vterm_replay_scan(rp)                                */
+/* index the frames the reader has got since last time  */
+int vterm_replay_scan(struct vterm_replay *rp)
+{
+    unsigned long time, size;
+
+    /* A frame that failed to read half way through has
+     * left part of its payload in the scratch terminal */
+    if(rp->stale && !vterm_replay_rewind(rp))
+        return 0;
+
+    while(vterm_replay_frame(rp, rp->scan_off, &time, &size)) {
+        if(!vterm_replay_feed(rp, &rp->scratch, rp->scan_off + VTERM_REPLAY_FRAME_HDR, size)) {
+            rp->stale = 1;
+            return vterm_replay_rewind(rp);
+        }
+        rp->scan_off += VTERM_REPLAY_FRAME_HDR + size;
+        rp->scan_time = time;
+        rp->pending += size;
+        if(rp->pending >= rp->interval && !vterm_replay_keyframe(rp))
+            return 0;
+    }
+
+    return 1;
+}
+
+/* vterm_replay_seek(rp, time)                          */
+/* bring the terminal to its state at the given time    */
+int vterm_replay_seek(struct vterm_replay *rp, unsigned long time)
+{
+    size_t lo = 0, hi = rp->num_keys, mid;
+    unsigned long frame_time, size;
+    VTERM_REPLAY_OFF off;
+
+    /* Last keyframe that is not past the target */
+    while(hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if(rp->keys[mid].time <= time)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    if(!vterm_load_state(rp->vt, rp->keys[lo].state, rp->keys[lo].size))
+        return 0;
+
+    for(off = rp->keys[lo].off; off < rp->scan_off; off += VTERM_REPLAY_FRAME_HDR + size) {
+        if(!vterm_replay_frame(rp, off, &frame_time, &size) || frame_time > time)
+            break;
+        if(!vterm_replay_feed(rp, rp->vt, off + VTERM_REPLAY_FRAME_HDR, size))
+            return 0;
+    }
+
+    return 1;
+}
+
+/* vterm_replay_duration(rp)                            */
+/* timestamp of the last frame indexed so far           */
+unsigned long vterm_replay_duration(const struct vterm_replay *rp)
+{
+    return rp->scan_time;
+}
@@ -0,0 +1,73 @@
+/* Copyright (c) 2021, Kirill GPRB
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+#ifndef _LIBVTERM_REPLAY_H_
+#define _LIBVTERM_REPLAY_H_ 1
+#include <libvterm.h>
+
+/* A recording is a sequence of frames: a 4-byte little-endian
+ * timestamp in milliseconds (never decreasing), a 4-byte little-endian
+ * payload size and then the payload - raw terminal output. */
+#define VTERM_REPLAY_FRAME_HDR (8)
+
+#define VTERM_REPLAY_CHUNK    (4096)
+#define VTERM_REPLAY_INTERVAL (1048576)
+
+/* Offsets into the recording; platforms with a 32-bit long
+ * should define it as a 64-bit type to index huge files. */
+#if !defined(VTERM_REPLAY_OFF)
+#    define VTERM_REPLAY_OFF unsigned long
+#endif
+
+struct vterm_replay_reader {
+    size_t (*read)(void *user, VTERM_REPLAY_OFF off, void *s, size_t n);
+    void *user;
+};
+
+struct vterm_keyframe {
+    unsigned long time;
+    VTERM_REPLAY_OFF off;
+    void *state;
+    size_t size;
+};
+
+struct vterm_replay {
+    struct vterm *vt;
+    struct vterm scratch;
+    struct vterm_replay_reader reader;
+    struct vterm_keyframe *keys;
+    size_t num_keys, max_keys;
+    size_t interval, pending;
+    VTERM_REPLAY_OFF scan_off;
+    unsigned long scan_time;
+    int stale;
+    unsigned char chunk[VTERM_REPLAY_CHUNK];
+};
+
+int vterm_replay_init(struct vterm_replay *rp, struct vterm *vt, const struct vterm_replay_reader *reader, size_t interval);
+void vterm_replay_shutdown(struct vterm_replay *rp);
+int vterm_replay_scan(struct vterm_replay *rp);
+int vterm_replay_seek(struct vterm_replay *rp, unsigned long time);
+unsigned long vterm_replay_duration(const struct vterm_replay *rp);
+
+#endif
@@ -0,0 +1,178 @@
+/* Copyright (c) 2021, Kirill GPRB
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+#include <libvterm_ring.h>
+#include <string.h>
+
+/* The ring buffer needs a full memory barrier (a CPU fence, not
+ * just a compiler one) between reading the other side's index, touching
+ * the data and publishing its own index. C89 has no notion of it so it
+ * is either taken from the compiler or supplied by the user. */
+#if !defined(VTERM_RING_BARRIER)
+#    if defined(__GNUC__) || defined(__clang__)
+#        define VTERM_RING_BARRIER() __sync_synchronize()
+#    elif defined(_MSC_VER)
+#        if !defined(WIN32_LEAN_AND_MEAN)
+#            define WIN32_LEAN_AND_MEAN
+#        endif
+#        include <windows.h>
+#        define VTERM_RING_BARRIER() MemoryBarrier()
+#    else
+#        error "libvterm: define VTERM_RING_BARRIER() as a full memory barrier"
+#    endif
+#endif
+
+/* vterm_ring_init(ring, vt, size)                      */
+/* allocate a ring buffer of at least size bytes        */
+int vterm_ring_init(struct vterm_ring *ring, struct vterm *vt, size_t size)
+{
+    size_t n = VTERM_RING_MIN_SIZE;
+
+    memset(ring, 0, sizeof(struct vterm_ring));
+
+    if(!vt->callbacks.mem_alloc || !vt->callbacks.mem_free)
+        return 0;
+
+    /* The indices are free-running and masked on access
+     * so the size of the buffer must be a power of two. */
+    while(n < size) {
+        if(n << 1 < n)
+            return 0;
+        n <<= 1;
+    }
+
+    ring->data = vt->callbacks.mem_alloc(n);
+    if(!ring->data)
+        return 0;
+
+    ring->vt = vt;
+    ring->size = n;
+    ring->head = 0;
+    ring->tail = 0;
+
+    return 1;
+}
+
+/* vterm_ring_shutdown(ring)                            */
+/* free the ring buffer                                 */
+void vterm_ring_shutdown(struct vterm_ring *ring)
+{
+    if(ring->vt)
+        ring->vt->callbacks.mem_free(ring->data);
+    memset(ring, 0, sizeof(struct vterm_ring));
+}
+
+/* vterm_ring_used(ring)                                */
+/* number of bytes waiting to be parsed                 */
+size_t vterm_ring_used(const struct vterm_ring *ring)
+{
+    return ring->head - ring->tail;
+}
+
+/* vterm_ring_free(ring)                                */
+/* number of bytes the producer can still push          */
+size_t vterm_ring_free(const struct vterm_ring *ring)
+{
+    return ring->size - (ring->head - ring->tail);
+}
+
+/* vterm_ring_reserve(ring, ptr)                        */
+/* producer: get a contiguous free span, 0 if full      */
+size_t vterm_ring_reserve(struct vterm_ring *ring, void **ptr)
+{
+    size_t head, tail, free, off;
+    head = ring->head;
+    tail = ring->tail;
+
+    /* Don't let the writes that follow overtake the
+     * consumer still reading the space it has freed */
+    VTERM_RING_BARRIER();
+
+    free = ring->size - (head - tail);
+    off = head & (ring->size - 1);
+    if(free > ring->size - off)
+        free = ring->size - off;
+    *ptr = ring->data + off;
+    return free;
+}
+
+/* vterm_ring_commit(ring, n)                           */
+/* producer: publish n bytes written after reserve      */
+void vterm_ring_commit(struct vterm_ring *ring, size_t n)
+{
+    VTERM_RING_BARRIER();
+    ring->head += n;
+}
+
+/* vterm_ring_push(ring, s, n)                          */
+/* producer: copy data in, returns the bytes accepted   */
+size_t vterm_ring_push(struct vterm_ring *ring, const void *s, size_t n)
+{
+    void *ptr;
+    size_t span, done = 0;
+    const unsigned char *sp = s;
+
+    /* The free space wraps around at most once */
+    while(done < n) {
+        span = vterm_ring_reserve(ring, &ptr);
+        if(!span)
+            break;
+        if(span > n - done)
+            span = n - done;
+        memcpy(ptr, sp + done, span);
+        vterm_ring_commit(ring, span);
+        done += span;
+    }
+
+    return done;
+}
+
+/* vterm_ring_drain(ring, max)                          */
+/* consumer: parse up to max bytes (0 means everything) */
+size_t vterm_ring_drain(struct vterm_ring *ring, size_t max)
+{
+    size_t head, tail, off, span, done = 0;
+
+    head = ring->head;
+    VTERM_RING_BARRIER();
+    tail = ring->tail;
+
+    if(!max || max > head - tail)
+        max = head - tail;
+
+    /* Hand the parser whole contiguous spans so the
+     * pending data is consumed in one or two batches */
+    while(done < max) {
+        off = tail & (ring->size - 1);
+        span = ring->size - off;
+        if(span > max - done)
+            span = max - done;
+        vterm_write(ring->vt, ring->data + off, span);
+        tail += span;
+        done += span;
+        VTERM_RING_BARRIER();
+        ring->tail = tail;
+    }
+
+    return done;
+}
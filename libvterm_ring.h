@@ -0,0 +1,50 @@
+/* Copyright (c) 2021, Kirill GPRB
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+#ifndef _LIBVTERM_RING_H_
+#define _LIBVTERM_RING_H_ 1
+#include <libvterm.h>
+
+#define VTERM_RING_MIN_SIZE (64)
+
+/* Single-producer/single-consumer byte ring. The producer
+ * (e.g. a PTY reader thread) pushes data while the consumer
+ * drains it through the parser of the attached terminal. */
+struct vterm_ring {
+    struct vterm *vt;
+    unsigned char *data;
+    size_t size;
+    volatile size_t head;
+    volatile size_t tail;
+};
+
+int vterm_ring_init(struct vterm_ring *ring, struct vterm *vt, size_t size);
+void vterm_ring_shutdown(struct vterm_ring *ring);
+size_t vterm_ring_used(const struct vterm_ring *ring);
+size_t vterm_ring_free(const struct vterm_ring *ring);
+size_t vterm_ring_reserve(struct vterm_ring *ring, void **ptr);
+void vterm_ring_commit(struct vterm_ring *ring, size_t n);
+size_t vterm_ring_push(struct vterm_ring *ring, const void *s, size_t n);
+size_t vterm_ring_drain(struct vterm_ring *ring, size_t max);
+
+#endif